@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2011  Benjamin Poulain
+ *
+ * This program is free software: you can redistribute it and or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "BlockIndex.h"
+
+namespace CallgrindParser {
+
+BlockIndex::BlockIndex(size_t positionCount)
+    : m_positionCount(positionCount)
+    , m_hasOpenBlock(false)
+    , m_indexedSize(0)
+{
+    assert(m_positionCount > 0);
+}
+
+void BlockIndex::addBlock(uint64_t offset, size_t functionIndex, const vector<uint64_t> &positions)
+{
+    assert(positions.size() == m_positionCount);
+    if (m_hasOpenBlock)
+        endBlock(offset);
+
+    const size_t blockIndex = m_blocks.size();
+    Block block = { offset, 0, functionIndex, notFound };
+    m_blocks.push_back(block);
+    m_positions.insert(m_positions.end(), positions.begin(), positions.end());
+    m_hasOpenBlock = true;
+
+    if (functionIndex >= m_firstBlockOfFunction.size()) {
+        m_firstBlockOfFunction.resize(functionIndex + 1, notFound);
+        m_lastBlockOfFunction.resize(functionIndex + 1, notFound);
+    }
+    if (m_lastBlockOfFunction[functionIndex] == notFound)
+        m_firstBlockOfFunction[functionIndex] = blockIndex;
+    else
+        m_blocks[m_lastBlockOfFunction[functionIndex]].nextBlockOfFunction = blockIndex;
+    m_lastBlockOfFunction[functionIndex] = blockIndex;
+}
+
+void BlockIndex::endBlock(uint64_t endOffset)
+{
+    if (!m_hasOpenBlock)
+        return;
+    Block &block = m_blocks.back();
+    assert(endOffset >= block.offset);
+    block.length = endOffset - block.offset;
+    m_hasOpenBlock = false;
+}
+
+size_t BlockIndex::firstBlockOfFunction(size_t functionIndex) const
+{
+    if (functionIndex >= m_firstBlockOfFunction.size())
+        return notFound;
+    return m_firstBlockOfFunction[functionIndex];
+}
+
+void BlockIndex::takeNameMappings(IdToNameMapping *functionMapping, IdToNameMapping *objectMapping, IdToNameMapping *fileMapping)
+{
+    m_functionMapping.swap(*functionMapping);
+    m_objectMapping.swap(*objectMapping);
+    m_fileMapping.swap(*fileMapping);
+}
+
+}
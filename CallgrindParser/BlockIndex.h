@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2011  Benjamin Poulain
+ *
+ * This program is free software: you can redistribute it and or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BlockIndex_h
+#define BlockIndex_h
+
+#include <cassert>
+#include <stdint.h>
+#include <string>
+#include <tr1/unordered_map>
+#include <vector>
+
+using namespace std;
+
+/* The classes below are exported */
+#pragma GCC visibility push(default)
+
+namespace CallgrindParser {
+
+typedef tr1::unordered_map<size_t, string> IdToNameMapping;
+
+// The location of every "fn=" block of a file, with the parser state needed to parse a block again on its own.
+//
+// The "ob=" and "fl=" context of a block is the object and file of its function descriptor in the Profile.
+// Compressed names are only defined once in a file, so the final name tables are valid to resume any block.
+// The positions are the last position of each column before the block, for relative position compression.
+class BlockIndex
+{
+public:
+    static const size_t notFound = static_cast<size_t>(-1);
+
+    struct Block {
+        uint64_t offset;
+        uint64_t length;
+        size_t functionIndex;
+        size_t nextBlockOfFunction;
+    };
+
+    BlockIndex(size_t positionCount);
+
+    void addBlock(uint64_t offset, size_t functionIndex, const vector<uint64_t> &positions);
+    void endBlock(uint64_t endOffset);
+    bool hasOpenBlock() const { return m_hasOpenBlock; }
+
+    size_t blockCount() const { return m_blocks.size(); }
+    const Block &blockAt(size_t index) const { assert(index < blockCount()); return m_blocks[index]; }
+    const uint64_t *positionsForBlock(size_t index) const { assert(index < blockCount()); return &m_positions[index * m_positionCount]; }
+    size_t positionCount() const { return m_positionCount; }
+
+    // The size of the indexed file, the offset following its last line.
+    void setIndexedSize(uint64_t indexedSize) { m_indexedSize = indexedSize; }
+    uint64_t indexedSize() const { return m_indexedSize; }
+
+    // The blocks of a function are chained through Block::nextBlockOfFunction, return notFound if there is none.
+    size_t firstBlockOfFunction(size_t functionIndex) const;
+
+    // The tables are swapped in, the given tables are left empty.
+    void takeNameMappings(IdToNameMapping *functionMapping, IdToNameMapping *objectMapping, IdToNameMapping *fileMapping);
+    const IdToNameMapping &functionMapping() const { return m_functionMapping; }
+    const IdToNameMapping &objectMapping() const { return m_objectMapping; }
+    const IdToNameMapping &fileMapping() const { return m_fileMapping; }
+
+private:
+    size_t m_positionCount;
+    vector<Block> m_blocks;
+    vector<uint64_t> m_positions;
+    bool m_hasOpenBlock;
+    uint64_t m_indexedSize;
+
+    vector<size_t> m_firstBlockOfFunction;
+    vector<size_t> m_lastBlockOfFunction;
+
+    IdToNameMapping m_functionMapping;
+    IdToNameMapping m_objectMapping;
+    IdToNameMapping m_fileMapping;
+};
+
+}
+
+#pragma GCC visibility pop
+
+#endif /* BlockIndex_h */
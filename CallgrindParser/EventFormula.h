@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2011  Benjamin Poulain
+ *
+ * This program is free software: you can redistribute it and or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EventFormula_h
+#define EventFormula_h
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/* The classes below are exported */
+#pragma GCC visibility push(default)
+
+namespace CallgrindParser {
+
+// A derived event, defined as an arithmetic expression over the native events of the profile.
+//
+// The formula syntax is a superset of the "event:" header of the Callgrind format: "Ir + 10 Bm + 100 L2m".
+// The operators + - * / and parenthesis are supported, a number followed by a name, a number
+// or a parenthesis is an implicit multiplication. Numbers are decimal, "digits[.digits]", whatever the locale.
+//
+// The formula is compiled to a small stack program, which is run over whole cost columns rather than function
+// by function. Each instruction is a tight loop over a block of rows that the compiler can vectorize.
+class EventFormula
+{
+public:
+    EventFormula(const string &name, const string &expression);
+
+    const string &name() const { return m_name; }
+    const string &expression() const { return m_expression; }
+
+    // Compile the expression. Names are resolved against the native events first, then against the derived events
+    // defined previously, whose program is inlined. Return false if the expression is invalid.
+    bool compile(const vector<string> &nativeEventNames, const vector<EventFormula> &derivedEvents);
+    bool isValid() const { return !m_program.empty(); }
+
+    // Evaluate the formula for rowCount rows. The input columns are indexed by native event.
+    // A division by zero gives zero, so the ratios of functions without the relevant events are neutral.
+    void evaluate(const vector<const uint64_t *> &nativeEventColumns, size_t rowCount, double *output) const;
+
+private:
+    enum Opcode {
+        LoadEvent,
+        LoadConstant,
+        Add,
+        Subtract,
+        Multiply,
+        Divide,
+        Negate
+    };
+
+    struct Instruction {
+        Opcode opcode;
+        size_t eventIndex;
+        double constant;
+    };
+
+    friend class FormulaCompiler;
+
+    string m_name;
+    string m_expression;
+    vector<Instruction> m_program;
+    size_t m_maxStackDepth;
+};
+
+}
+
+#pragma GCC visibility pop
+
+#endif /* EventFormula_h */
@@ -0,0 +1,598 @@
+/*
+ * Copyright (C) 2011  Benjamin Poulain
+ *
+ * This program is free software: you can redistribute it and or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FoldedStackExporter.h"
+
+#include "FunctionDescriptor.h"
+#include "Profile.h"
+
+#include <algorithm>
+#include <cassert>
+#include <memory>
+#include <pthread.h>
+
+namespace CallgrindParser {
+
+static const size_t defaultMaximumDepth = 128;
+static const double defaultMinimumCostFraction = 0.0001;
+// The buffered output is written to the stream when it grows over this size.
+static const size_t outputFlushSize = 64 * 1024;
+
+FoldedStackExporter::FoldedStackExporter(const Profile &profile, size_t eventIndex)
+    : m_profile(profile)
+    , m_eventIndex(eventIndex)
+    , m_maximumDepth(defaultMaximumDepth)
+    , m_minimumCost(0)
+    , m_minimumCostFraction(defaultMinimumCostFraction)
+    , m_threadCount(1)
+    , m_hasCallGraph(false)
+{
+}
+
+// The frames are separated by ';' and the count by the last space, the names cannot have ';' or a line break.
+static string frameName(const string &name)
+{
+    string result(name);
+    for (size_t i = 0; i < result.size(); ++i) {
+        if (result[i] == ';')
+            result[i] = ':';
+        else if (result[i] == '\n' || result[i] == '\r')
+            result[i] = ' ';
+    }
+    return result;
+}
+
+static inline void appendNumber(string *output, uint64_t value)
+{
+    char buffer[20];
+    size_t length = 0;
+    do {
+        buffer[length++] = '0' + (value % 10);
+        value /= 10;
+    } while (value);
+    while (length)
+        output->push_back(buffer[--length]);
+}
+
+void FoldedStackExporter::buildCallGraph()
+{
+    const size_t functionCount = m_profile.functionDescriptorCount();
+
+    m_selfCosts.resize(functionCount);
+    m_frameNames.resize(functionCount);
+    for (size_t i = 0; i < functionCount; ++i) {
+        m_selfCosts[i] = m_profile.nativeSelfCost(i, m_eventIndex);
+        m_frameNames[i] = frameName(m_profile.functionDescriptorAt(i)->name());
+    }
+
+    // Bucket the calls by caller. The direct recursion is left out, its cost is already in the caller.
+    m_firstEdge.assign(functionCount + 1, 0);
+    for (size_t i = 0; i < m_profile.callCount(); ++i) {
+        const Profile::Call &call = m_profile.callAt(i);
+        if (call.callerIndex != call.calleeIndex)
+            ++m_firstEdge[call.callerIndex + 1];
+    }
+    for (size_t i = 0; i < functionCount; ++i)
+        m_firstEdge[i + 1] += m_firstEdge[i];
+
+    vector<size_t> insertionIndex(m_firstEdge.begin(), m_firstEdge.end() - 1);
+    m_edges.resize(m_firstEdge[functionCount]);
+    for (size_t i = 0; i < m_profile.callCount(); ++i) {
+        const Profile::Call &call = m_profile.callAt(i);
+        if (call.callerIndex == call.calleeIndex)
+            continue;
+        Edge edge = { call.calleeIndex, m_profile.callInclusiveCost(i, m_eventIndex) };
+        m_edges[insertionIndex[call.callerIndex]++] = edge;
+    }
+
+    // Merge the calls to the same callee, and compact the edges.
+    size_t edgeCount = 0;
+    for (size_t caller = 0; caller < functionCount; ++caller) {
+        const size_t begin = m_firstEdge[caller];
+        const size_t end = m_firstEdge[caller + 1];
+        m_firstEdge[caller] = edgeCount;
+        sort(m_edges.begin() + begin, m_edges.begin() + end);
+        for (size_t i = begin; i < end; ++i) {
+            if (edgeCount > m_firstEdge[caller] && m_edges[edgeCount - 1].callee == m_edges[i].callee)
+                m_edges[edgeCount - 1].cost += m_edges[i].cost;
+            else
+                m_edges[edgeCount++] = m_edges[i];
+        }
+    }
+    m_firstEdge[functionCount] = edgeCount;
+    m_edges.resize(edgeCount);
+
+    m_inclusiveCosts.assign(m_selfCosts.begin(), m_selfCosts.end());
+    for (size_t caller = 0; caller < functionCount; ++caller) {
+        for (size_t i = m_firstEdge[caller]; i < m_firstEdge[caller + 1]; ++i)
+            m_inclusiveCosts[caller] += m_edges[i].cost;
+    }
+}
+
+// The roots are the functions without callers. The functions only reachable from a cycle get the first function
+// of the cycle as a root, so no cost is lost.
+void FoldedStackExporter::findRoots()
+{
+    const size_t functionCount = m_profile.functionDescriptorCount();
+
+    vector<char> hasCaller(functionCount, 0);
+    for (size_t i = 0; i < m_edges.size(); ++i)
+        hasCaller[m_edges[i].callee] = 1;
+
+    vector<char> isReachable(functionCount, 0);
+    vector<size_t> pending;
+    for (int pass = 0; pass < 2; ++pass) {
+        for (size_t function = 0; function < functionCount; ++function) {
+            if (isReachable[function] || !m_inclusiveCosts[function])
+                continue;
+            if (!pass && hasCaller[function])
+                continue;
+
+            m_roots.push_back(function);
+            isReachable[function] = 1;
+            pending.push_back(function);
+            while (!pending.empty()) {
+                const size_t caller = pending.back();
+                pending.pop_back();
+                for (size_t i = m_firstEdge[caller]; i < m_firstEdge[caller + 1]; ++i) {
+                    const size_t callee = m_edges[i].callee;
+                    if (!isReachable[callee]) {
+                        isReachable[callee] = 1;
+                        pending.push_back(callee);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Receives the buffered output of a StackExpander when it grows over outputFlushSize.
+class StackOutput
+{
+public:
+    virtual ~StackOutput() { }
+    // Consume the buffer, which is left empty.
+    virtual void flush(string *buffer) = 0;
+};
+
+class StreamStackOutput : public StackOutput
+{
+public:
+    StreamStackOutput(ostream &stream)
+        : m_stream(stream)
+    {
+    }
+
+    virtual void flush(string *buffer)
+    {
+        m_stream.write(buffer->data(), buffer->size());
+        buffer->clear();
+    }
+
+private:
+    ostream &m_stream;
+};
+
+// A part of the output of a root: lines already expanded, followed by the paths below a function reached with a
+// given cost. The tasks of a root, in order, give the same output as the root expanded at once.
+struct ExpansionTask {
+    static const size_t noFunction = static_cast<size_t>(-1);
+
+    string lines;
+    // noFunction when the task is only its lines.
+    size_t function;
+    double cost;
+    size_t depth;
+    double minimumCost;
+    // The frames above the function.
+    string path;
+    vector<size_t> pathFunctions;
+};
+
+// Expand the paths from one root, depth first.
+class StackExpander
+{
+public:
+    // The output is only used to flush the buffer, it can be null when the buffer does not need to be flushed.
+    StackExpander(const FoldedStackExporter &exporter, string *buffer, StackOutput *output)
+        : m_exporter(exporter)
+        , m_buffer(buffer)
+        , m_output(output)
+        , m_isOnPath(exporter.m_frameNames.size(), 0)
+        , m_minimumCost(0)
+    {
+    }
+
+    void expand(size_t root)
+    {
+        const ExpansionTask task = taskForRoot(root);
+        expand(task);
+    }
+
+    ExpansionTask taskForRoot(size_t root) const
+    {
+        ExpansionTask task;
+        task.function = root;
+        task.cost = static_cast<double>(m_exporter.m_inclusiveCosts[root]);
+        task.depth = 0;
+        // A subtree below one unit has nothing to print, it is always counted in its caller.
+        task.minimumCost = max(max<double>(1, m_exporter.m_minimumCost), task.cost * m_exporter.m_minimumCostFraction);
+        return task;
+    }
+
+    void expand(const ExpansionTask &task)
+    {
+        m_buffer->append(task.lines);
+        if (task.function == ExpansionTask::noFunction)
+            return;
+
+        m_minimumCost = task.minimumCost;
+        m_path = task.path;
+        setOnPath(task.pathFunctions, 1);
+        expand(task.function, task.cost, task.depth);
+        setOnPath(task.pathFunctions, 0);
+    }
+
+    // Expand the task down to the first function with several expanded callees, and make a task of each of them.
+    // The output of the functions above them is the lines of the first subtask. Without such a function, the
+    // task is expanded completely into a single task of lines.
+    void split(const ExpansionTask &task, vector<ExpansionTask> *subtasks)
+    {
+        assert(task.function != ExpansionTask::noFunction);
+        string lines(task.lines);
+        string *buffer = m_buffer;
+        m_buffer = &lines;
+        m_minimumCost = task.minimumCost;
+        m_path = task.path;
+        vector<size_t> pathFunctions(task.pathFunctions);
+        setOnPath(pathFunctions, 1);
+
+        size_t function = task.function;
+        double cost = task.cost;
+        size_t depth = task.depth;
+        vector<pair<size_t, double> > expandedCallees;
+        while (true) {
+            appendFrame(function, depth);
+            pathFunctions.push_back(function);
+
+            double scale;
+            bool expandsCallees;
+            emit(selfCost(function, cost, depth, &scale, &expandsCallees));
+
+            expandedCallees.clear();
+            if (expandsCallees) {
+                for (size_t i = m_exporter.m_firstEdge[function]; i < m_exporter.m_firstEdge[function + 1]; ++i) {
+                    const FoldedStackExporter::Edge &edge = m_exporter.m_edges[i];
+                    const double calleeCost = edge.cost * scale;
+                    if (isExpanded(edge.callee, calleeCost))
+                        expandedCallees.push_back(make_pair(edge.callee, calleeCost));
+                }
+            }
+            if (expandedCallees.size() != 1)
+                break;
+            function = expandedCallees[0].first;
+            cost = expandedCallees[0].second;
+            ++depth;
+        }
+
+        ExpansionTask subtask;
+        subtask.lines.swap(lines);
+        subtask.function = ExpansionTask::noFunction;
+        subtask.cost = 0;
+        subtask.depth = depth + 1;
+        subtask.minimumCost = m_minimumCost;
+        subtask.path = m_path;
+        subtask.pathFunctions = pathFunctions;
+        if (expandedCallees.empty())
+            subtasks->push_back(subtask);
+        for (size_t i = 0; i < expandedCallees.size(); ++i) {
+            subtask.function = expandedCallees[i].first;
+            subtask.cost = expandedCallees[i].second;
+            subtasks->push_back(subtask);
+            subtask.lines.clear();
+        }
+
+        setOnPath(pathFunctions, 0);
+        m_path.clear();
+        m_buffer = buffer;
+    }
+
+private:
+    void setOnPath(const vector<size_t> &functions, char isOnPath)
+    {
+        for (size_t i = 0; i < functions.size(); ++i)
+            m_isOnPath[functions[i]] = isOnPath;
+    }
+
+    void appendFrame(size_t function, size_t depth)
+    {
+        if (depth)
+            m_path.push_back(';');
+        m_path.append(m_exporter.m_frameNames[function]);
+        m_isOnPath[function] = 1;
+    }
+
+    // The function must be on the path.
+    double selfCost(size_t function, double cost, size_t depth, double *scale, bool *expandsCallees) const
+    {
+        const uint64_t inclusiveCost = m_exporter.m_inclusiveCosts[function];
+        *scale = inclusiveCost ? cost / inclusiveCost : 0;
+        // A callee with no cost of its own, like a function whose blocks are not in the profile, has nothing to split
+        // the cost of the call with. The whole cost is its self cost.
+        *expandsCallees = inclusiveCost && depth + 1 < m_exporter.m_maximumDepth;
+        if (!*expandsCallees)
+            return cost;
+
+        double selfCost = m_exporter.m_selfCosts[function] * *scale;
+        for (size_t i = m_exporter.m_firstEdge[function]; i < m_exporter.m_firstEdge[function + 1]; ++i) {
+            const FoldedStackExporter::Edge &edge = m_exporter.m_edges[i];
+            const double calleeCost = edge.cost * *scale;
+            if (!isExpanded(edge.callee, calleeCost))
+                selfCost += calleeCost;
+        }
+        return selfCost;
+    }
+
+    void expand(size_t function, double cost, size_t depth)
+    {
+        const size_t pathSize = m_path.size();
+        appendFrame(function, depth);
+
+        double scale;
+        bool expandsCallees;
+        emit(selfCost(function, cost, depth, &scale, &expandsCallees));
+
+        if (expandsCallees) {
+            for (size_t i = m_exporter.m_firstEdge[function]; i < m_exporter.m_firstEdge[function + 1]; ++i) {
+                const FoldedStackExporter::Edge &edge = m_exporter.m_edges[i];
+                const double calleeCost = edge.cost * scale;
+                if (isExpanded(edge.callee, calleeCost))
+                    expand(edge.callee, calleeCost, depth + 1);
+            }
+        }
+
+        m_isOnPath[function] = 0;
+        m_path.resize(pathSize);
+    }
+
+    bool isExpanded(size_t callee, double cost) const
+    {
+        return !m_isOnPath[callee] && cost >= m_minimumCost;
+    }
+
+    void emit(double cost)
+    {
+        const uint64_t roundedCost = static_cast<uint64_t>(cost + 0.5);
+        if (!roundedCost)
+            return;
+        m_buffer->append(m_path);
+        m_buffer->push_back(' ');
+        appendNumber(m_buffer, roundedCost);
+        m_buffer->push_back('\n');
+
+        if (m_output && m_buffer->size() > outputFlushSize)
+            m_output->flush(m_buffer);
+    }
+
+    const FoldedStackExporter &m_exporter;
+    string *m_buffer;
+    StackOutput *m_output;
+    vector<char> m_isOnPath;
+    string m_path;
+    double m_minimumCost;
+};
+
+// The roots are split into tasks: the largest task is split into the subtrees of the first function below it
+// calling several functions, until there are tasksPerThread tasks per thread or nothing left to split. A profile
+// with a single root, the usual case, is then expanded in parallel too.
+// The tasks are taken in order by the worker threads, the calling thread being one of them. Only the thread
+// expanding the first task not written yet, the head task, writes to the stream, progressively. The other
+// threads buffer up to outputFlushSize of their task and then wait for it to become the head, and a task
+// finished before it is the head is kept until the tasks before it are written. No new task is started
+// while maximumPendingTasksPerThread * threadCount tasks wait, so the memory used is bounded regardless of
+// the size of the profile.
+class ParallelExpansion
+{
+public:
+    ParallelExpansion(const FoldedStackExporter &exporter, size_t threadCount, ostream &stream)
+        : m_exporter(exporter)
+        , m_stream(stream)
+        , m_nextTask(0)
+        , m_headTask(0)
+        , m_pendingTaskCount(0)
+    {
+        createTasks(threadCount);
+        m_threadCount = min(threadCount, m_tasks.size());
+        m_pendingOutputs.assign(m_tasks.size(), static_cast<string *>(0));
+        pthread_mutex_init(&m_mutex, 0);
+        pthread_cond_init(&m_headChanged, 0);
+    }
+
+    ~ParallelExpansion()
+    {
+        for (size_t i = 0; i < m_pendingOutputs.size(); ++i)
+            delete m_pendingOutputs[i];
+        pthread_cond_destroy(&m_headChanged);
+        pthread_mutex_destroy(&m_mutex);
+    }
+
+    void run()
+    {
+        vector<pthread_t> threads;
+        for (size_t i = 1; i < m_threadCount; ++i) {
+            pthread_t thread;
+            if (pthread_create(&thread, 0, workerEntryPoint, this))
+                break;
+            threads.push_back(thread);
+        }
+        expandTasks();
+        for (size_t i = 0; i < threads.size(); ++i)
+            pthread_join(threads[i], 0);
+        assert(m_headTask == m_pendingOutputs.size());
+    }
+
+private:
+    static const size_t tasksPerThread = 4;
+    static const size_t maximumPendingTasksPerThread = 4;
+
+    // The output of one task, written when the task is the head task.
+    class TaskOutput : public StackOutput
+    {
+    public:
+        TaskOutput(ParallelExpansion *expansion, size_t taskIndex)
+            : m_expansion(expansion)
+            , m_taskIndex(taskIndex)
+        {
+        }
+
+        virtual void flush(string *buffer)
+        {
+            m_expansion->flushTask(m_taskIndex, buffer);
+        }
+
+    private:
+        ParallelExpansion *m_expansion;
+        size_t m_taskIndex;
+    };
+    friend class TaskOutput;
+
+    void createTasks(size_t threadCount)
+    {
+        StackExpander splitter(m_exporter, 0, 0);
+        for (size_t i = 0; i < m_exporter.m_roots.size(); ++i)
+            m_tasks.push_back(splitter.taskForRoot(m_exporter.m_roots[i]));
+
+        const size_t taskCount = tasksPerThread * threadCount;
+        while (m_tasks.size() < taskCount) {
+            size_t largestTask = ExpansionTask::noFunction;
+            for (size_t i = 0; i < m_tasks.size(); ++i) {
+                if (m_tasks[i].function != ExpansionTask::noFunction && (largestTask == ExpansionTask::noFunction || m_tasks[i].cost > m_tasks[largestTask].cost))
+                    largestTask = i;
+            }
+            if (largestTask == ExpansionTask::noFunction)
+                break;
+
+            vector<ExpansionTask> subtasks;
+            splitter.split(m_tasks[largestTask], &subtasks);
+            m_tasks.erase(m_tasks.begin() + largestTask);
+            m_tasks.insert(m_tasks.begin() + largestTask, subtasks.begin(), subtasks.end());
+        }
+    }
+
+    static void *workerEntryPoint(void *context)
+    {
+        static_cast<ParallelExpansion *>(context)->expandTasks();
+        return 0;
+    }
+
+    void expandTasks()
+    {
+        const size_t taskCount = m_pendingOutputs.size();
+        const size_t maximumPendingTasks = maximumPendingTasksPerThread * m_threadCount;
+        while (true) {
+            pthread_mutex_lock(&m_mutex);
+            while (m_nextTask < taskCount && m_pendingTaskCount >= maximumPendingTasks)
+                pthread_cond_wait(&m_headChanged, &m_mutex);
+            const size_t taskIndex = m_nextTask++;
+            pthread_mutex_unlock(&m_mutex);
+            if (taskIndex >= taskCount)
+                return;
+
+            auto_ptr<string> buffer(new string);
+            TaskOutput output(this, taskIndex);
+            StackExpander expander(m_exporter, buffer.get(), &output);
+            expander.expand(m_tasks[taskIndex]);
+            finishTask(taskIndex, buffer);
+        }
+    }
+
+    // Called when the buffer of a task is full: wait for the task to be the head, and write the buffer.
+    void flushTask(size_t taskIndex, string *buffer)
+    {
+        pthread_mutex_lock(&m_mutex);
+        while (taskIndex != m_headTask)
+            pthread_cond_wait(&m_headChanged, &m_mutex);
+        m_stream.write(buffer->data(), buffer->size());
+        pthread_mutex_unlock(&m_mutex);
+        buffer->clear();
+    }
+
+    // Write the output of the head task and of the finished tasks following it, or keep the output for later.
+    void finishTask(size_t taskIndex, auto_ptr<string> buffer)
+    {
+        pthread_mutex_lock(&m_mutex);
+        if (taskIndex != m_headTask) {
+            m_pendingOutputs[taskIndex] = buffer.release();
+            ++m_pendingTaskCount;
+            pthread_mutex_unlock(&m_mutex);
+            return;
+        }
+
+        m_stream.write(buffer->data(), buffer->size());
+        ++m_headTask;
+        while (m_headTask < m_pendingOutputs.size() && m_pendingOutputs[m_headTask]) {
+            string *pendingOutput = m_pendingOutputs[m_headTask];
+            m_stream.write(pendingOutput->data(), pendingOutput->size());
+            delete pendingOutput;
+            m_pendingOutputs[m_headTask] = 0;
+            --m_pendingTaskCount;
+            ++m_headTask;
+        }
+        pthread_cond_broadcast(&m_headChanged);
+        pthread_mutex_unlock(&m_mutex);
+    }
+
+    const FoldedStackExporter &m_exporter;
+    size_t m_threadCount;
+    ostream &m_stream;
+    vector<ExpansionTask> m_tasks;
+
+    pthread_mutex_t m_mutex;
+    pthread_cond_t m_headChanged;
+    size_t m_nextTask;
+    size_t m_headTask;
+    size_t m_pendingTaskCount;
+    // The output of the tasks finished before being the head task.
+    vector<string *> m_pendingOutputs;
+};
+
+bool FoldedStackExporter::write(ostream &output)
+{
+    if (m_eventIndex >= m_profile.eventCount() || m_profile.isDerivedEvent(m_eventIndex))
+        return false;
+
+    if (!m_hasCallGraph) {
+        buildCallGraph();
+        findRoots();
+        m_hasCallGraph = true;
+    }
+
+    if (m_threadCount > 1) {
+        ParallelExpansion expansion(*this, m_threadCount, output);
+        expansion.run();
+    } else {
+        string buffer;
+        StreamStackOutput streamOutput(output);
+        StackExpander expander(*this, &buffer, &streamOutput);
+        for (size_t i = 0; i < m_roots.size(); ++i)
+            expander.expand(m_roots[i]);
+        streamOutput.flush(&buffer);
+    }
+    return !output.fail();
+}
+
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2011  Benjamin Poulain
+ *
+ * This program is free software: you can redistribute it and or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FoldedStackExporter_h
+#define FoldedStackExporter_h
+
+#include <ostream>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/* The classes below are exported */
+#pragma GCC visibility push(default)
+
+namespace CallgrindParser {
+
+class Profile;
+
+// Write the folded stacks of a profile, "main;foo;bar 1234" per line, the input format of the flame graph tools.
+//
+// Callgrind only records the caller/callee pairs, not the full stacks. The stacks are rebuilt from the roots of
+// the call graph, and the cost reaching a function on a path is split between its self cost and its callees in
+// proportion of their inclusive costs.
+// The expansion stops at the maximum depth, and on a function already in the path so cycles terminate. Callees
+// below the minimum cost are counted in the self cost of their caller, which keeps the totals exact.
+// The number of paths grows exponentially with the calls that branch out and join again, so the minimum cost is
+// by default a fraction of the inclusive cost of the root: the paths of one depth share the cost of the root, there
+// are at most 1 / fraction of them above the cutoff.
+class FoldedStackExporter
+{
+public:
+    // The event must be a native event, the derived events have no inclusive costs on the calls.
+    FoldedStackExporter(const Profile &profile, size_t eventIndex);
+
+    void setMaximumDepth(size_t maximumDepth) { m_maximumDepth = maximumDepth; }
+    void setMinimumCost(uint64_t minimumCost) { m_minimumCost = minimumCost; }
+    // The minimum cost relative to the inclusive cost of the root, 1/10000 by default. Zero only keeps the absolute
+    // minimum cost, which can make the output exponentially large.
+    void setMinimumCostFraction(double minimumCostFraction) { m_minimumCostFraction = minimumCostFraction; }
+    // The subtrees of the roots are expanded in parallel, the output order does not depend on the thread count.
+    // The roots are split at the first functions calling several functions, so a single root is parallel too.
+    void setThreadCount(size_t threadCount) { m_threadCount = threadCount; }
+
+    // Return false if the event cannot be exported or the stream failed.
+    bool write(ostream &output);
+
+private:
+    struct Edge {
+        size_t callee;
+        uint64_t cost;
+
+        bool operator<(const Edge &other) const { return callee < other.callee; }
+    };
+
+    friend class StackExpander;
+    friend class ParallelExpansion;
+
+    void buildCallGraph();
+    void findRoots();
+
+    const Profile &m_profile;
+    size_t m_eventIndex;
+    size_t m_maximumDepth;
+    uint64_t m_minimumCost;
+    double m_minimumCostFraction;
+    size_t m_threadCount;
+
+    bool m_hasCallGraph;
+
+    // The callees of function i are m_edges[m_firstEdge[i]] to m_edges[m_firstEdge[i + 1]].
+    vector<size_t> m_firstEdge;
+    vector<Edge> m_edges;
+    vector<uint64_t> m_selfCosts;
+    vector<uint64_t> m_inclusiveCosts;
+    vector<string> m_frameNames;
+    vector<size_t> m_roots;
+};
+
+}
+
+#pragma GCC visibility pop
+
+#endif /* FoldedStackExporter_h */
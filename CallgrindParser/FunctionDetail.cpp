@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2011  Benjamin Poulain
+ *
+ * This program is free software: you can redistribute it and or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FunctionDetail.h"
+
+#include <algorithm>
+
+namespace CallgrindParser {
+
+FunctionDetail::FunctionDetail(size_t eventCount)
+    : m_eventCount(eventCount)
+{
+}
+
+void FunctionDetail::addCost(const string &file, uint64_t position, const vector<uint64_t> &costs)
+{
+    assert(costs.size() == m_eventCount);
+    tr1::unordered_map<string, size_t>::const_iterator fileIterator = m_fileIndexes.find(file);
+    size_t fileIndex;
+    if (fileIterator == m_fileIndexes.end()) {
+        fileIndex = m_files.size();
+        m_fileIndexes[file] = fileIndex;
+        m_files.push_back(file);
+        m_rowForPosition.push_back(tr1::unordered_map<uint64_t, size_t>());
+    } else
+        fileIndex = fileIterator->second;
+
+    tr1::unordered_map<uint64_t, size_t> &rowForPosition = m_rowForPosition[fileIndex];
+    tr1::unordered_map<uint64_t, size_t>::const_iterator iterator = rowForPosition.find(position);
+    size_t row;
+    if (iterator == rowForPosition.end()) {
+        row = m_positions.size();
+        rowForPosition[position] = row;
+        m_fileIndexForRow.push_back(fileIndex);
+        m_positions.push_back(position);
+        m_costs.resize(m_costs.size() + m_eventCount, 0);
+    } else
+        row = iterator->second;
+
+    for (size_t i = 0; i < m_eventCount; ++i)
+        m_costs[row * m_eventCount + i] += costs[i];
+}
+
+void FunctionDetail::addCall(const Call &call)
+{
+    assert(call.inclusiveCosts.size() == m_eventCount);
+    m_calls.push_back(call);
+}
+
+class RowOrder
+{
+public:
+    RowOrder(const vector<size_t> &fileIndexForRow, const vector<uint64_t> &positions)
+        : m_fileIndexForRow(fileIndexForRow)
+        , m_positions(positions)
+    {
+    }
+
+    bool operator()(size_t left, size_t right) const
+    {
+        if (m_fileIndexForRow[left] != m_fileIndexForRow[right])
+            return m_fileIndexForRow[left] < m_fileIndexForRow[right];
+        return m_positions[left] < m_positions[right];
+    }
+
+private:
+    const vector<size_t> &m_fileIndexForRow;
+    const vector<uint64_t> &m_positions;
+};
+
+void FunctionDetail::finish()
+{
+    const size_t rowCount = m_positions.size();
+    vector<size_t> order(rowCount);
+    for (size_t i = 0; i < rowCount; ++i)
+        order[i] = i;
+    sort(order.begin(), order.end(), RowOrder(m_fileIndexForRow, m_positions));
+
+    vector<size_t> sortedFileIndexForRow(rowCount);
+    vector<uint64_t> sortedPositions(rowCount);
+    vector<uint64_t> sortedCosts(m_costs.size());
+    for (size_t i = 0; i < rowCount; ++i) {
+        sortedFileIndexForRow[i] = m_fileIndexForRow[order[i]];
+        sortedPositions[i] = m_positions[order[i]];
+        vector<uint64_t>::const_iterator source = m_costs.begin() + order[i] * m_eventCount;
+        copy(source, source + m_eventCount, sortedCosts.begin() + i * m_eventCount);
+    }
+    m_fileIndexForRow.swap(sortedFileIndexForRow);
+    m_positions.swap(sortedPositions);
+    m_costs.swap(sortedCosts);
+    m_rowForPosition.clear();
+}
+
+}
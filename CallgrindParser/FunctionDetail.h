@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2011  Benjamin Poulain
+ *
+ * This program is free software: you can redistribute it and or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FunctionDetail_h
+#define FunctionDetail_h
+
+#include <cassert>
+#include <stdint.h>
+#include <string>
+#include <tr1/unordered_map>
+#include <vector>
+
+using namespace std;
+
+/* The classes below are exported */
+#pragma GCC visibility push(default)
+
+namespace CallgrindParser {
+
+// The position level costs and the calls of one function, loaded on demand from a BlockIndex.
+// Positions are the first position column of the file, the line number unless "positions:" says otherwise.
+// The rows are keyed by source file and position: the code inlined from another file ("fi=", "fe=") has its own
+// rows, even where its line numbers are the same as the lines of the function.
+class FunctionDetail
+{
+public:
+    struct Call {
+        string calleeName;
+        string calleeObject;
+        string calleeFile;
+        // The source file and position of the call.
+        string file;
+        uint64_t position;
+        uint64_t callCount;
+        vector<uint64_t> inclusiveCosts;
+    };
+
+    FunctionDetail(size_t eventCount);
+
+    size_t eventCount() const { return m_eventCount; }
+
+    // The costs of a position of a file are accumulated.
+    void addCost(const string &file, uint64_t position, const vector<uint64_t> &costs);
+    void addCall(const Call &call);
+    // Sort the rows by file, in order of appearance, then by position. To be called once all the blocks of the
+    // function are parsed.
+    void finish();
+
+    size_t positionCount() const { return m_positions.size(); }
+    const string &fileAt(size_t index) const { assert(index < positionCount()); return m_files[m_fileIndexForRow[index]]; }
+    uint64_t positionAt(size_t index) const { assert(index < positionCount()); return m_positions[index]; }
+    uint64_t costAt(size_t index, size_t eventIndex) const { assert(index < positionCount() && eventIndex < m_eventCount); return m_costs[index * m_eventCount + eventIndex]; }
+
+    size_t callCount() const { return m_calls.size(); }
+    const Call &callAt(size_t index) const { assert(index < callCount()); return m_calls[index]; }
+
+private:
+    size_t m_eventCount;
+    vector<string> m_files;
+    tr1::unordered_map<string, size_t> m_fileIndexes;
+    vector<size_t> m_fileIndexForRow;
+    vector<uint64_t> m_positions;
+    // Indexed by [row * eventCount + event].
+    vector<uint64_t> m_costs;
+    // The row of each position, by file index.
+    vector<tr1::unordered_map<uint64_t, size_t> > m_rowForPosition;
+    vector<Call> m_calls;
+};
+
+}
+
+#pragma GCC visibility pop
+
+#endif /* FunctionDetail_h */
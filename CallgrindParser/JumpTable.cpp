@@ -0,0 +1,175 @@
+/*
+ * Copyright (C) 2011  Benjamin Poulain
+ *
+ * This program is free software: you can redistribute it and or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "JumpTable.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace CallgrindParser {
+
+// Little endian base 128: 7 bits per byte, the high bit is set on all bytes but the last.
+static inline void appendVarint(vector<uint8_t> *data, uint64_t value)
+{
+    while (value >= 0x80) {
+        data->push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    data->push_back(static_cast<uint8_t>(value));
+}
+
+static inline uint64_t readVarint(const vector<uint8_t> &data, size_t *index)
+{
+    uint64_t value = 0;
+    unsigned shift = 0;
+    while (true) {
+        assert(*index < data.size());
+        const uint8_t byte = data[(*index)++];
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return value;
+        shift += 7;
+    }
+}
+
+// Map the signed differences to unsigned integers so small negative values stay small: 0, -1, 1, -2, 2...
+static inline uint64_t zigZagEncode(uint64_t from, uint64_t to)
+{
+    const int64_t difference = static_cast<int64_t>(to - from);
+    return (static_cast<uint64_t>(difference) << 1) ^ static_cast<uint64_t>(difference >> 63);
+}
+
+static inline uint64_t zigZagDecode(uint64_t from, uint64_t encoded)
+{
+    const uint64_t difference = (encoded >> 1) ^ (0 - (encoded & 1));
+    return from + difference;
+}
+
+JumpTable::JumpTable()
+    : m_lastSourceFile(0)
+    , m_lastSource(0)
+    , m_jumpCount(0)
+{
+}
+
+enum JumpFlags {
+    ConditionalJumpFlag = 1 << 0,
+    SourceFileChangedFlag = 1 << 1,
+    TargetInOtherFileFlag = 1 << 2
+};
+
+// Each jump is: a byte of JumpFlags, zigzag(source file - previous source file) if it changed, zigzag(target file -
+// source file) if they differ, zigzag(source - previous source), zigzag(target - source), executed, and taken for
+// the conditional jumps only. The flags have their own byte so the differences keep all their 64 bits.
+void JumpTable::addJump(const Jump &jump)
+{
+    uint8_t flags = jump.isConditional ? ConditionalJumpFlag : 0;
+    if (jump.sourceFile != m_lastSourceFile)
+        flags |= SourceFileChangedFlag;
+    if (jump.targetFile != jump.sourceFile)
+        flags |= TargetInOtherFileFlag;
+    m_data.push_back(flags);
+    if (flags & SourceFileChangedFlag)
+        appendVarint(&m_data, zigZagEncode(m_lastSourceFile, jump.sourceFile));
+    if (flags & TargetInOtherFileFlag)
+        appendVarint(&m_data, zigZagEncode(jump.sourceFile, jump.targetFile));
+    appendVarint(&m_data, zigZagEncode(m_lastSource, jump.source));
+    appendVarint(&m_data, zigZagEncode(jump.source, jump.target));
+    appendVarint(&m_data, jump.executed);
+    if (jump.isConditional)
+        appendVarint(&m_data, jump.taken);
+    m_lastSourceFile = jump.sourceFile;
+    m_lastSource = jump.source;
+    ++m_jumpCount;
+}
+
+vector<JumpTable::Jump> JumpTable::jumps() const
+{
+    vector<Jump> result;
+    result.reserve(m_jumpCount);
+
+    size_t lastSourceFile = 0;
+    uint64_t lastSource = 0;
+    size_t index = 0;
+    while (index < m_data.size()) {
+        Jump jump;
+        const uint8_t flags = m_data[index++];
+        jump.isConditional = flags & ConditionalJumpFlag;
+        jump.sourceFile = (flags & SourceFileChangedFlag) ? zigZagDecode(lastSourceFile, readVarint(m_data, &index)) : lastSourceFile;
+        jump.targetFile = (flags & TargetInOtherFileFlag) ? zigZagDecode(jump.sourceFile, readVarint(m_data, &index)) : jump.sourceFile;
+        jump.source = zigZagDecode(lastSource, readVarint(m_data, &index));
+        jump.target = zigZagDecode(jump.source, readVarint(m_data, &index));
+        jump.executed = readVarint(m_data, &index);
+        jump.taken = jump.isConditional ? readVarint(m_data, &index) : jump.executed;
+        lastSourceFile = jump.sourceFile;
+        lastSource = jump.source;
+        result.push_back(jump);
+    }
+    assert(result.size() == m_jumpCount);
+    return result;
+}
+
+static bool hasLowerEdge(const JumpTable::Jump &left, const JumpTable::Jump &right)
+{
+    if (left.sourceFile != right.sourceFile)
+        return left.sourceFile < right.sourceFile;
+    if (left.source != right.source)
+        return left.source < right.source;
+    if (left.targetFile != right.targetFile)
+        return left.targetFile < right.targetFile;
+    return left.target < right.target;
+}
+
+static bool isSameEdge(const JumpTable::Jump &left, const JumpTable::Jump &right)
+{
+    return left.sourceFile == right.sourceFile && left.source == right.source
+           && left.targetFile == right.targetFile && left.target == right.target;
+}
+
+static bool hasHigherExecutionCount(const JumpTable::Jump &left, const JumpTable::Jump &right)
+{
+    return left.executed > right.executed;
+}
+
+vector<JumpTable::Jump> JumpTable::conditionalJumpsByExecutionCount() const
+{
+    vector<Jump> allJumps = jumps();
+    vector<Jump> conditionalJumps;
+    for (size_t i = 0; i < allJumps.size(); ++i) {
+        if (allJumps[i].isConditional)
+            conditionalJumps.push_back(allJumps[i]);
+    }
+    if (conditionalJumps.empty())
+        return conditionalJumps;
+
+    sort(conditionalJumps.begin(), conditionalJumps.end(), hasLowerEdge);
+    size_t mergedCount = 1;
+    for (size_t i = 1; i < conditionalJumps.size(); ++i) {
+        Jump &last = conditionalJumps[mergedCount - 1];
+        if (isSameEdge(last, conditionalJumps[i])) {
+            last.executed += conditionalJumps[i].executed;
+            last.taken += conditionalJumps[i].taken;
+        } else
+            conditionalJumps[mergedCount++] = conditionalJumps[i];
+    }
+    conditionalJumps.resize(mergedCount);
+
+    stable_sort(conditionalJumps.begin(), conditionalJumps.end(), hasHigherExecutionCount);
+    return conditionalJumps;
+}
+
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2011  Benjamin Poulain
+ *
+ * This program is free software: you can redistribute it and or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JumpTable_h
+#define JumpTable_h
+
+#include <stdint.h>
+#include <vector>
+
+using namespace std;
+
+/* The classes below are exported */
+#pragma GCC visibility push(default)
+
+namespace CallgrindParser {
+
+// The jumps of one function, from the "jump=" and "jcnd=" lines of profiles recorded with --collect-jumps=yes.
+// Only the jumps within the function are kept. Their positions can still be in several files when code is
+// inlined, so each position comes with the index of its file in the source file table of the Profile.
+//
+// The jumps are stored as a byte stream of variable length integers. The source is encoded relative to the
+// source of the previous jump and the target relative to the source, which keeps most jumps to a few bytes.
+// The files are only stored when they change.
+class JumpTable
+{
+public:
+    struct Jump {
+        size_t sourceFile;
+        uint64_t source;
+        size_t targetFile;
+        uint64_t target;
+        uint64_t executed;
+        // The number of times a conditional jump was taken, equal to executed for an unconditional jump.
+        uint64_t taken;
+        bool isConditional;
+
+        double takenRatio() const { return executed ? static_cast<double>(taken) / executed : 0; }
+    };
+
+    JumpTable();
+
+    void addJump(const Jump &jump);
+    size_t jumpCount() const { return m_jumpCount; }
+    size_t encodedSize() const { return m_data.size(); }
+
+    // Decode the jumps, in the order they were added.
+    vector<Jump> jumps() const;
+    // The conditional jumps with the same source and target merged, by decreasing execution count.
+    vector<Jump> conditionalJumpsByExecutionCount() const;
+
+private:
+    vector<uint8_t> m_data;
+    size_t m_lastSourceFile;
+    uint64_t m_lastSource;
+    size_t m_jumpCount;
+};
+
+}
+
+#pragma GCC visibility pop
+
+#endif /* JumpTable_h */
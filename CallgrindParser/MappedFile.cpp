@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2011  Benjamin Poulain
+ *
+ * This program is free software: you can redistribute it and or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "MappedFile.h"
+
+#include <cassert>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace CallgrindParser {
+
+MappedFile::MappedFile()
+    : m_data(0)
+    , m_size(0)
+{
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(const string &path)
+{
+    close();
+
+    int fileDescriptor = ::open(path.c_str(), O_RDONLY);
+    if (fileDescriptor < 0)
+        return false;
+
+    struct stat fileStatus;
+    if (fstat(fileDescriptor, &fileStatus) || !fileStatus.st_size) {
+        ::close(fileDescriptor);
+        return false;
+    }
+
+    void *mapping = mmap(0, fileStatus.st_size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+    // The mapping stays valid after the file descriptor is closed.
+    ::close(fileDescriptor);
+    if (mapping == MAP_FAILED)
+        return false;
+
+    m_data = static_cast<const char *>(mapping);
+    m_size = fileStatus.st_size;
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (!m_data)
+        return;
+    munmap(const_cast<char *>(m_data), m_size);
+    m_data = 0;
+    m_size = 0;
+}
+
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2011  Benjamin Poulain
+ *
+ * This program is free software: you can redistribute it and or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MappedFile_h
+#define MappedFile_h
+
+#include <string>
+
+using namespace std;
+
+/* The classes below are exported */
+#pragma GCC visibility push(default)
+
+namespace CallgrindParser {
+
+// A read only memory mapping of a whole file, the pages are only loaded when accessed.
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+
+    // Map the file, return false on failure.
+    bool open(const string &path);
+    void close();
+
+    bool isOpen() const { return !!m_data; }
+    const char *data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+private:
+    MappedFile(const MappedFile &);
+    MappedFile &operator=(const MappedFile &);
+
+    const char *m_data;
+    size_t m_size;
+};
+
+}
+
+#pragma GCC visibility pop
+
+#endif /* MappedFile_h */
@@ -17,20 +17,33 @@
 
 #include "Parser.h"
 
+#include "FunctionDescriptor.h"
+
+#include <algorithm>
 #include <cassert>
+#include <stdint.h>
 
 using namespace std;
 
 namespace CallgrindParser
 {
 
-Parser::Parser()
-    : m_readingStage(FormatVersion)
+Parser::Parser(bool buildsBlockIndex)
+    : m_buildsBlockIndex(buildsBlockIndex)
+    , m_currentLineOffset(0)
+    , m_nextLineOffset(0)
+    , m_readingStage(FormatVersion)
+    , m_positionCount(1)
+    , m_hasCurrentFunction(false)
+    , m_currentFunctionIndex(0)
 {
 }
 
 bool Parser::parseLine(const char *data, size_t size)
 {
+    m_currentLineOffset = m_nextLineOffset;
+    m_nextLineOffset += size + 1;
+
     switch (m_readingStage) {
         case FormatVersion:
             return processFormatVersionLine(data, size);
@@ -50,6 +63,24 @@ auto_ptr<Profile>& Parser::profile()
     return m_profile;
 }
 
+auto_ptr<BlockIndex>& Parser::blockIndex()
+{
+    return m_blockIndex;
+}
+
+template<size_t prefixSizeWithNull>
+static inline bool hasPrefix(const char *data, size_t size, const char (&prefix)[prefixSizeWithNull])
+{
+    const size_t prefixSize = prefixSizeWithNull - 1;
+    if (size < prefixSize)
+        return false;
+    for (size_t i = 0; i < prefixSize; ++i) {
+        if (data[i] != prefix[i])
+            return false;
+    }
+    return true;
+}
+
 bool Parser::processFormatVersionLine(const char *data, size_t size)
 {
     m_readingStage = Creator;
@@ -110,16 +141,97 @@ bool Parser::processHeaderLine(const char *data, size_t size)
         return true;
     }
 
+    if (hasPrefix(data, size, "events:")) {
+        processEventsLine(data + 7, size - 7);
+        return true;
+    }
+
+    if (hasPrefix(data, size, "event:")) {
+        processEventDefinitionLine(data + 6, size - 6);
+        return true;
+    }
+
+    if (hasPrefix(data, size, "positions:")) {
+        processPositionsLine(data + 10, size - 10);
+        return true;
+    }
+
     // FIXME: implement parsing for all the headers.
     for (size_t i = 0; i < size; ++i) {
         if (data[i] == ':')
             return true;
     }
 
-    m_readingStage = Body;
+    beginBody();
     return processBodyLine(data, size);
 }
 
+static inline size_t skipSpaces(const char *data, size_t index, size_t size)
+{
+    while (index < size && (data[index] == ' ' || data[index] == '\t' || data[index] == '\r'))
+        ++index;
+    return index;
+}
+
+static inline string trimmed(const char *data, size_t size)
+{
+    size_t start = skipSpaces(data, 0, size);
+    while (size > start && (data[size - 1] == ' ' || data[size - 1] == '\t' || data[size - 1] == '\r'))
+        --size;
+    return string(data + start, size - start);
+}
+
+void Parser::processEventsLine(const char *data, size_t size)
+{
+    m_eventNames.clear();
+    size_t index = skipSpaces(data, 0, size);
+    while (index < size) {
+        const size_t nameStart = index;
+        while (index < size && data[index] != ' ' && data[index] != '\t' && data[index] != '\r')
+            ++index;
+        if (index > nameStart)
+            m_eventNames.push_back(string(data + nameStart, index - nameStart));
+        index = skipSpaces(data, index + 1, size);
+    }
+}
+
+// "event: <name> [= <formula>] [: <long name>]". Only the definitions with a formula are of interest.
+void Parser::processEventDefinitionLine(const char *data, size_t size)
+{
+    size_t formulaStart = size;
+    size_t formulaEnd = size;
+    for (size_t i = 0; i < size; ++i) {
+        if (data[i] == '=' && formulaStart == size)
+            formulaStart = i;
+        else if (data[i] == ':') {
+            formulaEnd = i;
+            break;
+        }
+    }
+    if (formulaStart >= formulaEnd)
+        return;
+
+    const string name = trimmed(data, formulaStart);
+    const string formula = trimmed(data + formulaStart + 1, formulaEnd - formulaStart - 1);
+    if (name.size() && formula.size())
+        m_derivedEventDefinitions.push_back(make_pair(name, formula));
+}
+
+// "positions: [instr] [line]", the number of position columns preceding the costs.
+void Parser::processPositionsLine(const char *data, size_t size)
+{
+    size_t positionCount = 0;
+    size_t index = skipSpaces(data, 0, size);
+    while (index < size && data[index] != '\r') {
+        ++positionCount;
+        while (index < size && data[index] != ' ' && data[index] != '\t' && data[index] != '\r')
+            ++index;
+        index = skipSpaces(data, index, size);
+    }
+    if (positionCount)
+        m_positionCount = positionCount;
+}
+
 static inline size_t extractIdPart(const char *data, size_t *currentIndex, size_t size, bool *success)
 {
     // Preconditions that must be ensured by the caller. This is a shortcut thanks to the condition (size >= 5)
@@ -175,24 +287,39 @@ static inline string extractNamePart(const char *data, size_t currentIndex, size
     return string();
 }
 
-static inline string extractName(const char *data, size_t offset, size_t size, IdToNameMapping *nameMapping)
+static inline void resolveCompressedName(size_t id, string *name, IdToNameMapping *nameMapping)
+{
+    if (name->size())
+        (*nameMapping)[id] = *name;
+    else
+        *name = (*nameMapping)[id];
+}
+
+// A constant mapping already holds the final name table, as recorded by a BlockIndex.
+static inline void resolveCompressedName(size_t id, string *name, const IdToNameMapping *nameMapping)
+{
+    if (name->size())
+        return;
+    IdToNameMapping::const_iterator iterator = nameMapping->find(id);
+    if (iterator != nameMapping->end())
+        *name = iterator->second;
+}
+
+template<typename Mapping>
+static inline string extractName(const char *data, size_t offset, size_t size, Mapping *nameMapping)
 {
     bool hasCompressedId = false;
     size_t id = extractIdPart(data, &offset, size, &hasCompressedId);
     string name = extractNamePart(data, offset, size);
 
-    if (hasCompressedId) {
-        if (name.size())
-            (*nameMapping)[id] = name;
-        else
-            name = (*nameMapping)[id];
-    }
+    if (hasCompressedId)
+        resolveCompressedName(id, &name, nameMapping);
 
     return name;
 }
 
-template<char first, char second>
-static string processBodyLineTwoLetterSymbol(const char *data, size_t size, IdToNameMapping *mapping)
+template<char first, char second, typename Mapping>
+static string processBodyLineTwoLetterSymbol(const char *data, size_t size, Mapping *mapping)
 {
     if (size < 5) // 5 = len("xy= n") || len("xy=()")
         return string();
@@ -204,44 +331,520 @@ static string processBodyLineTwoLetterSymbol(const char *data, size_t size, IdTo
     return extractName(data, startIndex, size, mapping);
 }
 
-template<char first, char second>
-static string processBodyLineTwoLetterCalledSymbol(const char *data, size_t size, IdToNameMapping *mapping)
+// "cfn=", "cob=", "cfl=" and "cfi=" for the target of a call, "jfn=" and "jfi=" for the target of a jump.
+template<char prefix, char first, char second, typename Mapping>
+static string processBodyLinePrefixedTwoLetterSymbol(const char *data, size_t size, Mapping *mapping)
 {
     assert(size >= 1);
-    if (data[0] == 'c')
+    if (data[0] == prefix)
         return processBodyLineTwoLetterSymbol<first, second>(data + 1, size - 1, mapping);
     return string();
 }
 
-bool Parser::processBodyLine(const char *data, size_t size)
+static inline bool isCostLineStartCharacter(char character)
 {
-    if (!size)
-        return true;
+    return (character >= '0' && character <= '9') || character == '+' || character == '-' || character == '*';
+}
 
-    string functionName = processBodyLineTwoLetterSymbol<'f', 'n'>(data, size, &m_functionMapping);
-    if (functionName.size()) {
-        m_profile->addFunction(functionName, m_objectContext, m_fileContext);
-        return true;
+// Parse a decimal or hexadecimal ("0x") number, return false if there is no digit at the index.
+static inline bool parseNumber(const char *data, size_t *index, size_t size, uint64_t *value)
+{
+    size_t i = *index;
+    uint64_t result = 0;
+    if (i + 2 < size && data[i] == '0' && (data[i + 1] == 'x' || data[i + 1] == 'X')) {
+        i += 2;
+        const size_t digitsStart = i;
+        for (; i < size; ++i) {
+            const char character = data[i];
+            if (character >= '0' && character <= '9')
+                result = (result << 4) | (character - '0');
+            else if (character >= 'a' && character <= 'f')
+                result = (result << 4) | (character - 'a' + 10);
+            else if (character >= 'A' && character <= 'F')
+                result = (result << 4) | (character - 'A' + 10);
+            else
+                break;
+        }
+        if (i == digitsStart)
+            return false;
+    } else {
+        const size_t digitsStart = i;
+        for (; i < size; ++i) {
+            const unsigned char digit = data[i] - '0';
+            if (digit >= 10)
+                break;
+            result = result * 10 + digit;
+        }
+        if (i == digitsStart)
+            return false;
     }
+    *index = i;
+    *value = result;
+    return true;
+}
 
-    string calledFunctionName = processBodyLineTwoLetterCalledSymbol<'f', 'n'>(data, size, &m_functionMapping);
-    if (calledFunctionName.size())
+// Parse a position, which can be absolute, relative to the previous position ("+n", "-n"), or the same ("*").
+static inline bool parsePosition(const char *data, size_t *index, size_t size, uint64_t previousPosition, uint64_t *position)
+{
+    assert(*index < size);
+    const char character = data[*index];
+    if (character == '*') {
+        ++*index;
+        *position = previousPosition;
         return true;
+    }
+    if (character == '+' || character == '-') {
+        ++*index;
+        uint64_t offset;
+        if (!parseNumber(data, index, size, &offset))
+            return false;
+        *position = (character == '+') ? previousPosition + offset : previousPosition - offset;
+        return true;
+    }
+    return parseNumber(data, index, size, position);
+}
 
-    string object = processBodyLineTwoLetterSymbol<'o', 'b'>(data, size, &m_objectMapping);
-    if (object.size())
+// Parse "<positions> <costs>", update the positions and fill the costs. Missing trailing costs are zero.
+static inline bool parseCostLine(const char *data, size_t size, vector<uint64_t> *positions, vector<uint64_t> *costs)
+{
+    size_t index = 0;
+    for (size_t i = 0; i < positions->size(); ++i) {
+        index = skipSpaces(data, index, size);
+        if (index >= size)
+            return false;
+        if (!parsePosition(data, &index, size, (*positions)[i], &(*positions)[i]))
+            return false;
+    }
+
+    const size_t costCount = costs->size();
+    for (size_t i = 0; i < costCount; ++i) {
+        index = skipSpaces(data, index, size);
+        uint64_t cost = 0;
+        if (index < size && !parseNumber(data, &index, size, &cost))
+            return false;
+        (*costs)[i] = cost;
+    }
+    return true;
+}
+
+// The state machine of the body lines, shared by the parser of the whole file and the parser of the blocks of
+// one function so they cannot disagree on the meaning of a line.
+// The Client receives the interpreted lines:
+//     processFunction(name, object, file, positions) for "fn=", before the costs of the function.
+//     processCost(sourceFile, positions, costs) for a line of self cost.
+//     processCall(sourceFile, calleeName, calleeObject, calleeFile, callCount, positions, inclusiveCosts) for the line
+//     following "calls=".
+//     processJump(sourceFile, targetFile, jump) for the line following "jump=" or "jcnd=", which is then also
+//     processed as a cost line. The file indexes of the jump are left to the client. The jumps to another
+//     function ("jfn=") are not reported, their target position is not a position of the current function.
+//     processEndOfFunctions() for "totals:" and "summary:".
+// The source file of the cost lines is the file of the function ("fl="), or the file given by "fi=" or "fe=" for
+// the code inlined from another file, until the next "fn=".
+// The Mapping is the name table of the compressed names. When it is constant, names are only resolved.
+template<typename Mapping, typename Client>
+class BodyLineReader
+{
+public:
+    BodyLineReader(Client *client, Mapping *functionMapping, Mapping *objectMapping, Mapping *fileMapping, size_t positionCount, size_t eventCount)
+        : m_client(client)
+        , m_functionMapping(functionMapping)
+        , m_objectMapping(objectMapping)
+        , m_fileMapping(fileMapping)
+        , m_positions(positionCount, 0)
+        , m_costs(eventCount, 0)
+        , m_nextCostLine(SelfCostLine)
+        , m_pendingCallCount(0)
+        , m_pendingJump()
+    {
+    }
+
+    // Restart at a line inside the body, with the context recorded for it.
+    void resume(const string &object, const string &file, const uint64_t *positions)
+    {
         m_objectContext = object;
+        m_fileContext = file;
+        m_sourceFile = file;
+        m_positions.assign(positions, positions + m_positions.size());
+        m_nextCostLine = SelfCostLine;
+        resetCallee();
+        m_jumpTargetFunction.clear();
+        m_jumpTargetFile.clear();
+    }
 
-    processBodyLineTwoLetterCalledSymbol<'o', 'b'>(data, size, &m_objectMapping);
-    
-    string fileName = processBodyLineTwoLetterSymbol<'f', 'l'>(data, size, &m_fileMapping);
-    if (fileName.size())
-        m_fileContext = fileName;
+    void processLine(const char *data, size_t size)
+    {
+        if (!size)
+            return;
+
+        if (isCostLineStartCharacter(data[0])) {
+            processCostLine(data, size);
+            return;
+        }
+
+        string name = processBodyLineTwoLetterSymbol<'f', 'n'>(data, size, m_functionMapping);
+        if (name.size()) {
+            m_functionName = name;
+            m_sourceFile = m_fileContext;
+            m_client->processFunction(name, m_objectContext, m_fileContext, m_positions);
+            return;
+        }
+
+        name = processBodyLinePrefixedTwoLetterSymbol<'c', 'f', 'n'>(data, size, m_functionMapping);
+        if (name.size()) {
+            m_calleeName = name;
+            return;
+        }
+
+        if (hasPrefix(data, size, "calls=")) {
+            size_t index = 6; // 6 = len("calls=")
+            m_pendingCallCount = 0;
+            parseNumber(data, &index, size, &m_pendingCallCount);
+            m_nextCostLine = CallCostLine;
+            return;
+        }
+
+        name = processBodyLinePrefixedTwoLetterSymbol<'j', 'f', 'n'>(data, size, m_functionMapping);
+        if (name.size()) {
+            m_jumpTargetFunction = name;
+            return;
+        }
+
+        name = processBodyLinePrefixedTwoLetterSymbol<'j', 'f', 'i'>(data, size, m_fileMapping);
+        if (name.size()) {
+            m_jumpTargetFile = name;
+            return;
+        }
+
+        if (hasPrefix(data, size, "jump=")) {
+            processJumpLine(data, size, false);
+            return;
+        }
+
+        if (hasPrefix(data, size, "jcnd=")) {
+            processJumpLine(data, size, true);
+            return;
+        }
+
+        if (hasPrefix(data, size, "totals:") || hasPrefix(data, size, "summary:")) {
+            m_client->processEndOfFunctions();
+            return;
+        }
+
+        name = processBodyLineTwoLetterSymbol<'o', 'b'>(data, size, m_objectMapping);
+        if (name.size()) {
+            m_objectContext = name;
+            return;
+        }
+
+        name = processBodyLinePrefixedTwoLetterSymbol<'c', 'o', 'b'>(data, size, m_objectMapping);
+        if (name.size()) {
+            m_calleeObject = name;
+            return;
+        }
+
+        name = processBodyLineTwoLetterSymbol<'f', 'l'>(data, size, m_fileMapping);
+        if (name.size()) {
+            m_fileContext = name;
+            m_sourceFile = name;
+            return;
+        }
+
+        name = processBodyLineTwoLetterSymbol<'f', 'i'>(data, size, m_fileMapping);
+        if (name.empty())
+            name = processBodyLineTwoLetterSymbol<'f', 'e'>(data, size, m_fileMapping);
+        if (name.size()) {
+            m_sourceFile = name;
+            return;
+        }
+
+        name = processBodyLinePrefixedTwoLetterSymbol<'c', 'f', 'l'>(data, size, m_fileMapping);
+        if (name.empty())
+            name = processBodyLinePrefixedTwoLetterSymbol<'c', 'f', 'i'>(data, size, m_fileMapping);
+        if (name.size())
+            m_calleeFile = name;
 
-    processBodyLineTwoLetterCalledSymbol<'f', 'l'>(data, size, &m_fileMapping);
+        // FIXME: fully implement body parsing.
+    }
 
-    // FIXME: fully implement body parsing.
+private:
+    void resetCallee()
+    {
+        m_calleeName.clear();
+        m_calleeObject.clear();
+        m_calleeFile.clear();
+    }
+
+    void processCostLine(const char *data, size_t size)
+    {
+        if (!parseCostLine(data, size, &m_positions, &m_costs))
+            return;
+
+        switch (m_nextCostLine) {
+        case CallCostLine:
+            m_nextCostLine = SelfCostLine;
+            // The inclusive cost of a call without a callee name is dropped, it is not self cost either.
+            if (m_calleeName.size()) {
+                m_client->processCall(m_sourceFile, m_calleeName,
+                                      m_calleeObject.size() ? m_calleeObject : m_objectContext,
+                                      m_calleeFile.size() ? m_calleeFile : m_sourceFile,
+                                      m_pendingCallCount, m_positions, m_costs);
+            }
+            resetCallee();
+            return;
+        case JumpSourceLine:
+            // The source line of a jump usually has no cost, any cost it has is still self cost.
+            m_nextCostLine = SelfCostLine;
+            m_pendingJump.source = m_positions[0];
+            m_client->processJump(m_sourceFile, m_pendingJumpTargetFile, m_pendingJump);
+            break;
+        case SelfCostLine:
+            break;
+        }
+        m_client->processCost(m_sourceFile, m_positions, m_costs);
+    }
+
+    // "jump=<count> <target>" and "jcnd=<taken>/<executed> <target>". The format description also has the form
+    // "jcnd=<executed> <taken> <target>" without a slash. Only the first position of the target is kept.
+    void processJumpLine(const char *data, size_t size, bool isConditional)
+    {
+        // A jump from inlined code back to the function's file ("jfi=" only) is still within the function.
+        const bool isLocalJump = m_jumpTargetFunction.empty() || m_jumpTargetFunction == m_functionName;
+        const string targetFile = m_jumpTargetFile.size() ? m_jumpTargetFile : m_sourceFile;
+        m_jumpTargetFunction.clear();
+        m_jumpTargetFile.clear();
+        if (!isLocalJump)
+            return;
+
+        size_t index = 5; // 5 = len("jump=") = len("jcnd=")
+        uint64_t firstCount;
+        if (!parseNumber(data, &index, size, &firstCount))
+            return;
+
+        uint64_t executed = firstCount;
+        uint64_t taken = firstCount;
+        if (isConditional) {
+            uint64_t secondCount;
+            const bool hasSlash = index < size && data[index] == '/';
+            index = skipSpaces(data, index + (hasSlash ? 1 : 0), size);
+            if (!parseNumber(data, &index, size, &secondCount))
+                return;
+            executed = hasSlash ? secondCount : firstCount;
+            taken = hasSlash ? firstCount : secondCount;
+        }
+
+        uint64_t target = m_positions[0];
+        index = skipSpaces(data, index, size);
+        if (index >= size || !parsePosition(data, &index, size, m_positions[0], &target))
+            return;
+
+        m_pendingJumpTargetFile = targetFile;
+        m_pendingJump.target = target;
+        m_pendingJump.executed = executed;
+        m_pendingJump.taken = taken;
+        m_pendingJump.isConditional = isConditional;
+        m_nextCostLine = JumpSourceLine;
+    }
+
+    Client *m_client;
+    Mapping *m_functionMapping;
+    Mapping *m_objectMapping;
+    Mapping *m_fileMapping;
+
+    string m_functionName;
+    string m_objectContext;
+    string m_fileContext;
+    string m_sourceFile;
+    // The target of the next call, the object defaults to the current object and the file to the current source
+    // file, which is the file given by "fi=" or "fe=" inside inlined code.
+    string m_calleeName;
+    string m_calleeObject;
+    string m_calleeFile;
+
+    vector<uint64_t> m_positions;
+    vector<uint64_t> m_costs;
+
+    // The line following "calls=" holds the inclusive cost of the call, the line following "jump=" or "jcnd="
+    // holds the source position of the jump.
+    enum {
+        SelfCostLine,
+        CallCostLine,
+        JumpSourceLine
+    } m_nextCostLine;
+    uint64_t m_pendingCallCount;
+    JumpTable::Jump m_pendingJump;
+    string m_pendingJumpTargetFile;
+    // The target of the next jump when it is outside the current function or file.
+    string m_jumpTargetFunction;
+    string m_jumpTargetFile;
+};
+
+Parser::~Parser()
+{
+}
+
+void Parser::finishBlockIndex()
+{
+    if (!m_blockIndex.get())
+        return;
+    m_blockIndex->endBlock(m_nextLineOffset);
+    m_blockIndex->setIndexedSize(m_nextLineOffset);
+    m_blockIndex->takeNameMappings(&m_functionMapping, &m_objectMapping, &m_fileMapping);
+    // The name tables now belong to the index, the body cannot go on.
+    m_bodyLineReader.reset();
+}
+
+void Parser::beginBody()
+{
+    m_readingStage = Body;
+    if (!m_profile.get())
+        return;
+
+    if (m_buildsBlockIndex)
+        m_blockIndex = auto_ptr<BlockIndex>(new BlockIndex(m_positionCount));
+    m_bodyLineReader = auto_ptr<BodyLineReader<IdToNameMapping, Parser> >(new BodyLineReader<IdToNameMapping, Parser>(this, &m_functionMapping, &m_objectMapping, &m_fileMapping, m_positionCount, m_eventNames.size()));
+
+    m_profile->setNativeEvents(m_eventNames);
+    // Invalid formulas from the file are ignored, the native events remain usable.
+    for (size_t i = 0; i < m_derivedEventDefinitions.size(); ++i)
+        m_profile->addDerivedEvent(m_derivedEventDefinitions[i].first, m_derivedEventDefinitions[i].second);
+    m_derivedEventDefinitions.clear();
+}
+
+bool Parser::processBodyLine(const char *data, size_t size)
+{
+    if (m_bodyLineReader.get())
+        m_bodyLineReader->processLine(data, size);
     return true;
 }
 
-}
\ No newline at end of file
+void Parser::processFunction(const string &name, const string &object, const string &file, const vector<uint64_t> &positions)
+{
+    m_currentFunctionIndex = m_profile->indexForFunction(name, object, file);
+    m_hasCurrentFunction = true;
+    if (m_blockIndex.get())
+        m_blockIndex->addBlock(m_currentLineOffset, m_currentFunctionIndex, positions);
+}
+
+void Parser::processCost(const string &, const vector<uint64_t> &, const vector<uint64_t> &costs)
+{
+    if (m_hasCurrentFunction && costs.size())
+        m_profile->addSelfCost(m_currentFunctionIndex, &costs[0], costs.size());
+}
+
+void Parser::processCall(const string &, const string &calleeName, const string &calleeObject, const string &calleeFile, uint64_t callCount, const vector<uint64_t> &, const vector<uint64_t> &inclusiveCosts)
+{
+    if (!m_hasCurrentFunction)
+        return;
+    const size_t calleeIndex = m_profile->indexForFunction(calleeName, calleeObject, calleeFile);
+    m_profile->addCall(m_currentFunctionIndex, calleeIndex, callCount, inclusiveCosts.size() ? &inclusiveCosts[0] : 0, inclusiveCosts.size());
+}
+
+void Parser::processJump(const string &sourceFile, const string &targetFile, const JumpTable::Jump &jump)
+{
+    if (!m_hasCurrentFunction)
+        return;
+    JumpTable::Jump jumpWithFiles = jump;
+    jumpWithFiles.sourceFile = m_profile->indexForSourceFile(sourceFile);
+    jumpWithFiles.targetFile = m_profile->indexForSourceFile(targetFile);
+    m_profile->addJump(m_currentFunctionIndex, jumpWithFiles);
+}
+
+void Parser::processEndOfFunctions()
+{
+    if (m_blockIndex.get())
+        m_blockIndex->endBlock(m_currentLineOffset);
+}
+
+// Lines with positions only, like the source of a jump, do not contribute a cost.
+static inline bool hasCost(const vector<uint64_t> &costs)
+{
+    for (size_t i = 0; i < costs.size(); ++i) {
+        if (costs[i])
+            return true;
+    }
+    return false;
+}
+
+// Collect the detail of one function from its blocks, with the state recorded in the BlockIndex.
+class FunctionBlockParser
+{
+public:
+    FunctionBlockParser(const BlockIndex &blockIndex, const FunctionDescriptor &functionDescriptor, FunctionDetail *detail)
+        : m_blockIndex(blockIndex)
+        , m_functionDescriptor(functionDescriptor)
+        , m_detail(detail)
+        , m_reader(this, &blockIndex.functionMapping(), &blockIndex.objectMapping(), &blockIndex.fileMapping(), blockIndex.positionCount(), detail->eventCount())
+    {
+    }
+
+    void parseBlock(size_t blockNumber, const char *data, size_t size)
+    {
+        m_reader.resume(m_functionDescriptor.object(), m_functionDescriptor.file(), m_blockIndex.positionsForBlock(blockNumber));
+
+        size_t lineStart = 0;
+        while (lineStart < size) {
+            size_t lineEnd = lineStart;
+            while (lineEnd < size && data[lineEnd] != '\n')
+                ++lineEnd;
+            m_reader.processLine(data + lineStart, lineEnd - lineStart);
+            lineStart = lineEnd + 1;
+        }
+    }
+
+    // The "fn=" line starts the block, the block ends before the next function.
+    void processFunction(const string &, const string &, const string &, const vector<uint64_t> &) { }
+
+    void processCost(const string &sourceFile, const vector<uint64_t> &positions, const vector<uint64_t> &costs)
+    {
+        if (hasCost(costs))
+            m_detail->addCost(sourceFile, positions[0], costs);
+    }
+
+    void processCall(const string &sourceFile, const string &calleeName, const string &calleeObject, const string &calleeFile, uint64_t callCount, const vector<uint64_t> &positions, const vector<uint64_t> &inclusiveCosts)
+    {
+        FunctionDetail::Call call;
+        call.calleeName = calleeName;
+        call.calleeObject = calleeObject;
+        call.calleeFile = calleeFile;
+        call.file = sourceFile;
+        call.position = positions[0];
+        call.callCount = callCount;
+        call.inclusiveCosts = inclusiveCosts;
+        m_detail->addCall(call);
+    }
+
+    void processJump(const string &, const string &, const JumpTable::Jump &) { }
+    void processEndOfFunctions() { }
+
+private:
+    const BlockIndex &m_blockIndex;
+    const FunctionDescriptor &m_functionDescriptor;
+    FunctionDetail *m_detail;
+    BodyLineReader<const IdToNameMapping, FunctionBlockParser> m_reader;
+};
+
+auto_ptr<FunctionDetail> Parser::parseFunctionDetail(const Profile &profile, const BlockIndex &blockIndex, size_t functionIndex, const char *fileData, size_t fileSize)
+{
+    assert(functionIndex < profile.functionDescriptorCount());
+
+    // Every line was counted with a newline, the last one may not have it in the file.
+    const uint64_t indexedSize = blockIndex.indexedSize();
+    const bool hasFinalNewline = fileSize && fileData[fileSize - 1] == '\n';
+    if (fileSize != indexedSize && (hasFinalNewline || fileSize + 1 != indexedSize))
+        return auto_ptr<FunctionDetail>();
+
+    auto_ptr<FunctionDetail> detail(new FunctionDetail(profile.nativeEventCount()));
+    FunctionBlockParser blockParser(blockIndex, *profile.functionDescriptorAt(functionIndex), detail.get());
+    for (size_t blockNumber = blockIndex.firstBlockOfFunction(functionIndex); blockNumber != BlockIndex::notFound; blockNumber = blockIndex.blockAt(blockNumber).nextBlockOfFunction) {
+        const BlockIndex::Block &block = blockIndex.blockAt(blockNumber);
+        // Every block starts with the "fn=" line of its function, anything else means the file changed since indexing.
+        if (block.offset >= fileSize || !hasPrefix(fileData + block.offset, fileSize - block.offset, "fn="))
+            return auto_ptr<FunctionDetail>();
+        const uint64_t length = min<uint64_t>(block.length, fileSize - block.offset);
+        blockParser.parseBlock(blockNumber, fileData + block.offset, length);
+    }
+    detail->finish();
+    return detail;
+}
+
+}
@@ -18,9 +18,12 @@
 #ifndef Parser_h
 #define Parser_h
 
+#include "BlockIndex.h"
+#include "FunctionDetail.h"
 #include "Profile.h"
 
 #include <memory>
+#include <utility>
 #include <tr1/unordered_map>
 
 /* The classes below are exported */
@@ -29,26 +32,57 @@
 namespace CallgrindParser
 {
 
-typedef tr1::unordered_map<size_t, string> IdToNameMapping;
+template<typename Mapping, typename Client> class BodyLineReader;
 
 class Parser
 {
 public:
-    Parser();
+    // When building the block index, the lines must be given in file order, without their newline character.
+    explicit Parser(bool buildsBlockIndex = false);
+    ~Parser();
 
     // Parse the line, and return true if parsing should continue.
     bool parseLine(const char *data, size_t size);
 
     auto_ptr<Profile>& profile();
 
+    // Close the last block and move the final name tables to the index, to be called once after the last line.
+    // The lines given after it are ignored.
+    void finishBlockIndex();
+    // Only available when building the block index, complete once finishBlockIndex() is called.
+    auto_ptr<BlockIndex>& blockIndex();
+
+    // Parse the detail of one function from the blocks recorded in the index, typically on a mapped file.
+    // Return a null pointer if the index does not match the file: the size of the file differs from the indexed
+    // size, or a block does not start with its "fn=" line.
+    static auto_ptr<FunctionDetail> parseFunctionDetail(const Profile &profile, const BlockIndex &blockIndex, size_t functionIndex, const char *fileData, size_t fileSize);
+
 private:
     bool processFormatVersionLine(const char *data, size_t size);
     bool processCreatorLine(const char *data, size_t size);
     bool processHeaderLine(const char *data, size_t size);
     bool processBodyLine(const char *data, size_t size);
 
+    void processEventsLine(const char *data, size_t size);
+    void processEventDefinitionLine(const char *data, size_t size);
+    void processPositionsLine(const char *data, size_t size);
+    void beginBody();
+
+    // The body lines interpreted by the BodyLineReader.
+    template<typename Mapping, typename Client> friend class BodyLineReader;
+    void processFunction(const string &name, const string &object, const string &file, const vector<uint64_t> &positions);
+    void processCost(const string &sourceFile, const vector<uint64_t> &positions, const vector<uint64_t> &costs);
+    void processCall(const string &sourceFile, const string &calleeName, const string &calleeObject, const string &calleeFile, uint64_t callCount, const vector<uint64_t> &positions, const vector<uint64_t> &inclusiveCosts);
+    void processJump(const string &sourceFile, const string &targetFile, const JumpTable::Jump &jump);
+    void processEndOfFunctions();
+
     auto_ptr<Profile> m_profile;
 
+    bool m_buildsBlockIndex;
+    auto_ptr<BlockIndex> m_blockIndex;
+    uint64_t m_currentLineOffset;
+    uint64_t m_nextLineOffset;
+
     enum {
         FormatVersion,
         Creator,
@@ -59,9 +93,15 @@ private:
     IdToNameMapping m_functionMapping;
     IdToNameMapping m_objectMapping;
     IdToNameMapping m_fileMapping;
+    auto_ptr<BodyLineReader<IdToNameMapping, Parser> > m_bodyLineReader;
+
+    vector<string> m_eventNames;
+    // The "event:" definitions with a formula, registered on the profile when the body starts.
+    vector<pair<string, string> > m_derivedEventDefinitions;
+    size_t m_positionCount;
 
-    string m_objectContext;
-    string m_fileContext;
+    bool m_hasCurrentFunction;
+    size_t m_currentFunctionIndex;
 };
 
 }
@@ -19,9 +19,16 @@
 
 #include "FunctionDescriptor.h"
 
+#include <algorithm>
+
 namespace CallgrindParser
 {
 
+Profile::Profile()
+    : m_derivedSelfCostsValid(false)
+{
+}
+
 Profile::~Profile()
 {
     const size_t vectorSize = functionDescriptorCount();
@@ -38,7 +45,216 @@ FunctionDescriptor *Profile::addFunction(const string &name, const string &objec
 {
     FunctionDescriptor *newFunctionDescriptor = new FunctionDescriptor(name, object, file);
     m_functionDescriptors.push_back(newFunctionDescriptor);
+    for (size_t i = 0; i < m_nativeSelfCosts.size(); ++i)
+        m_nativeSelfCosts[i].push_back(0);
+    m_derivedSelfCostsValid = false;
+    m_jumpTables.push_back(JumpTable());
     return newFunctionDescriptor;
 }
 
+size_t Profile::indexForFunction(const string &name, const string &object, const string &file)
+{
+    string key;
+    key.reserve(name.size() + object.size() + file.size() + 2);
+    key.append(object).append(1, '\0').append(file).append(1, '\0').append(name);
+
+    tr1::unordered_map<string, size_t>::const_iterator iterator = m_functionIndexes.find(key);
+    if (iterator != m_functionIndexes.end())
+        return iterator->second;
+
+    const size_t index = functionDescriptorCount();
+    addFunction(name, object, file);
+    m_functionIndexes[key] = index;
+    return index;
+}
+
+void Profile::setNativeEvents(const vector<string> &eventNames)
+{
+    assert(!functionDescriptorCount());
+    assert(m_derivedEvents.empty());
+    m_nativeEventNames = eventNames;
+    m_nativeSelfCosts.assign(m_nativeEventNames.size(), vector<uint64_t>());
+}
+
+const string &Profile::eventName(size_t eventIndex) const
+{
+    if (isDerivedEvent(eventIndex))
+        return m_derivedEvents[eventIndex - nativeEventCount()].name();
+    return m_nativeEventNames[eventIndex];
+}
+
+bool Profile::addDerivedEvent(const string &name, const string &formula)
+{
+    if (name.empty())
+        return false;
+    for (size_t i = 0; i < eventCount(); ++i) {
+        if (eventName(i) == name)
+            return false;
+    }
+
+    EventFormula eventFormula(name, formula);
+    if (!eventFormula.compile(m_nativeEventNames, m_derivedEvents))
+        return false;
+    m_derivedEvents.push_back(eventFormula);
+    m_derivedSelfCostsValid = false;
+    return true;
+}
+
+void Profile::addSelfCost(size_t functionIndex, const uint64_t *costs, size_t costCount)
+{
+    assert(functionIndex < functionDescriptorCount());
+    assert(costCount <= nativeEventCount());
+    for (size_t i = 0; i < costCount; ++i)
+        m_nativeSelfCosts[i][functionIndex] += costs[i];
+    m_derivedSelfCostsValid = false;
+}
+
+uint64_t Profile::nativeSelfCost(size_t functionIndex, size_t eventIndex) const
+{
+    assert(functionIndex < functionDescriptorCount());
+    assert(!isDerivedEvent(eventIndex));
+    return m_nativeSelfCosts[eventIndex][functionIndex];
+}
+
+double Profile::selfCost(size_t functionIndex, size_t eventIndex) const
+{
+    assert(functionIndex < functionDescriptorCount());
+    if (isDerivedEvent(eventIndex))
+        return derivedEventColumn(eventIndex)[functionIndex];
+    return static_cast<double>(m_nativeSelfCosts[eventIndex][functionIndex]);
+}
+
+const vector<double> &Profile::derivedEventColumn(size_t eventIndex) const
+{
+    assert(isDerivedEvent(eventIndex));
+    if (!m_derivedSelfCostsValid) {
+        m_derivedSelfCosts.assign(m_derivedEvents.size(), vector<double>());
+        m_derivedSelfCostsValid = true;
+    }
+
+    vector<double> &column = m_derivedSelfCosts[eventIndex - nativeEventCount()];
+    const size_t functionCount = functionDescriptorCount();
+    if (column.size() != functionCount) {
+        column.resize(functionCount);
+        if (functionCount) {
+            vector<const uint64_t *> nativeColumns(nativeEventCount());
+            for (size_t i = 0; i < nativeColumns.size(); ++i)
+                nativeColumns[i] = &m_nativeSelfCosts[i][0];
+            m_derivedEvents[eventIndex - nativeEventCount()].evaluate(nativeColumns, functionCount, &column[0]);
+        }
+    }
+    return column;
+}
+
+// Order function indices by decreasing value in a column, ties are kept in function order.
+template<typename ValueType>
+class DecreasingColumnOrder
+{
+public:
+    DecreasingColumnOrder(const vector<ValueType> &column) : m_column(column) { }
+    bool operator()(size_t left, size_t right) const { return m_column[left] > m_column[right]; }
+
+private:
+    const vector<ValueType> &m_column;
+};
+
+template<typename ValueType>
+static vector<size_t> sortedByDecreasingValue(const vector<ValueType> &column)
+{
+    vector<size_t> indices(column.size());
+    for (size_t i = 0; i < indices.size(); ++i)
+        indices[i] = i;
+    stable_sort(indices.begin(), indices.end(), DecreasingColumnOrder<ValueType>(column));
+    return indices;
+}
+
+template<typename ValueType>
+static vector<size_t> indicesWithValueAbove(const vector<ValueType> &column, double threshold)
+{
+    vector<size_t> indices;
+    for (size_t i = 0; i < column.size(); ++i) {
+        if (static_cast<double>(column[i]) >= threshold)
+            indices.push_back(i);
+    }
+    return indices;
+}
+
+vector<size_t> Profile::functionsSortedBySelfCost(size_t eventIndex) const
+{
+    if (isDerivedEvent(eventIndex))
+        return sortedByDecreasingValue(derivedEventColumn(eventIndex));
+    return sortedByDecreasingValue(m_nativeSelfCosts[eventIndex]);
+}
+
+vector<size_t> Profile::functionsWithSelfCostAbove(size_t eventIndex, double threshold) const
+{
+    if (isDerivedEvent(eventIndex))
+        return indicesWithValueAbove(derivedEventColumn(eventIndex), threshold);
+    return indicesWithValueAbove(m_nativeSelfCosts[eventIndex], threshold);
+}
+
+void Profile::addCall(size_t callerIndex, size_t calleeIndex, uint64_t count, const uint64_t *inclusiveCosts, size_t costCount)
+{
+    assert(callerIndex < functionDescriptorCount());
+    assert(calleeIndex < functionDescriptorCount());
+    assert(costCount <= nativeEventCount());
+
+    Call call = { callerIndex, calleeIndex, count };
+    m_calls.push_back(call);
+    m_callInclusiveCosts.insert(m_callInclusiveCosts.end(), inclusiveCosts, inclusiveCosts + costCount);
+    m_callInclusiveCosts.resize(m_calls.size() * nativeEventCount(), 0);
+}
+
+uint64_t Profile::callInclusiveCost(size_t callIndex, size_t eventIndex) const
+{
+    assert(callIndex < callCount());
+    assert(!isDerivedEvent(eventIndex));
+    return m_callInclusiveCosts[callIndex * nativeEventCount() + eventIndex];
+}
+
+size_t Profile::indexForSourceFile(const string &file)
+{
+    tr1::unordered_map<string, size_t>::const_iterator iterator = m_sourceFileIndexes.find(file);
+    if (iterator != m_sourceFileIndexes.end())
+        return iterator->second;
+
+    const size_t index = m_sourceFiles.size();
+    m_sourceFiles.push_back(file);
+    m_sourceFileIndexes[file] = index;
+    return index;
+}
+
+void Profile::addJump(size_t functionIndex, const JumpTable::Jump &jump)
+{
+    assert(functionIndex < functionDescriptorCount());
+    assert(jump.sourceFile < sourceFileCount() && jump.targetFile < sourceFileCount());
+    m_jumpTables[functionIndex].addJump(jump);
+}
+
+static bool hasHigherExecutionCount(const Profile::Branch &left, const Profile::Branch &right)
+{
+    return left.jump.executed > right.jump.executed;
+}
+
+vector<Profile::Branch> Profile::hottestConditionalBranches(size_t maxCount) const
+{
+    vector<Branch> branches;
+    for (size_t i = 0; i < m_jumpTables.size(); ++i) {
+        if (!m_jumpTables[i].jumpCount())
+            continue;
+        // Each function contributes at most maxCount branches.
+        const vector<JumpTable::Jump> jumps = m_jumpTables[i].conditionalJumpsByExecutionCount();
+        const size_t count = min(maxCount, jumps.size());
+        for (size_t j = 0; j < count; ++j) {
+            Branch branch = { i, jumps[j] };
+            branches.push_back(branch);
+        }
+    }
+
+    const size_t count = min(maxCount, branches.size());
+    partial_sort(branches.begin(), branches.begin() + count, branches.end(), hasHigherExecutionCount);
+    branches.resize(count);
+    return branches;
+}
+
 }
\ No newline at end of file
@@ -18,8 +18,13 @@
 #ifndef Profile_h
 #define Profile_h
 
+#include "EventFormula.h"
+#include "JumpTable.h"
+
 #include <cassert>
+#include <stdint.h>
 #include <string>
+#include <tr1/unordered_map>
 #include <vector>
 
 using namespace std;
@@ -34,6 +39,7 @@ class FunctionDescriptor;
 class Profile
 {
 public:
+    Profile();
     ~Profile();
 
     bool isValid() const;
@@ -44,10 +50,78 @@ public:
     FunctionDescriptor *addFunction(const string &name, const string &object, const string &file);
     size_t functionDescriptorCount() const { return m_functionDescriptors.size(); }
     FunctionDescriptor *functionDescriptorAt(size_t index) { assert(index < functionDescriptorCount()); return m_functionDescriptors.at(index); }
+    const FunctionDescriptor *functionDescriptorAt(size_t index) const { assert(index < functionDescriptorCount()); return m_functionDescriptors.at(index); }
+
+    // Return the index of the function, adding it if it was not seen before.
+    size_t indexForFunction(const string &name, const string &object, const string &file);
+
+    // The events are indexed with the native events first, followed by the derived events.
+    void setNativeEvents(const vector<string> &eventNames);
+    size_t nativeEventCount() const { return m_nativeEventNames.size(); }
+    size_t eventCount() const { return m_nativeEventNames.size() + m_derivedEvents.size(); }
+    bool isDerivedEvent(size_t eventIndex) const { assert(eventIndex < eventCount()); return eventIndex >= nativeEventCount(); }
+    const string &eventName(size_t eventIndex) const;
+
+    // Add a derived event, return false if the name is already used or the formula is invalid.
+    bool addDerivedEvent(const string &name, const string &formula);
+
+    void addSelfCost(size_t functionIndex, const uint64_t *costs, size_t costCount);
+    uint64_t nativeSelfCost(size_t functionIndex, size_t eventIndex) const;
+    // Self cost of any event. The derived event columns are computed on first access and cached.
+    double selfCost(size_t functionIndex, size_t eventIndex) const;
+
+    // Function indices ordered by decreasing cost.
+    vector<size_t> functionsSortedBySelfCost(size_t eventIndex) const;
+    // Function indices whose cost is at least the threshold, in function order.
+    vector<size_t> functionsWithSelfCostAbove(size_t eventIndex, double threshold) const;
+
+    struct Call {
+        size_t callerIndex;
+        size_t calleeIndex;
+        uint64_t count;
+    };
+    void addCall(size_t callerIndex, size_t calleeIndex, uint64_t count, const uint64_t *inclusiveCosts, size_t costCount);
+    size_t callCount() const { return m_calls.size(); }
+    const Call &callAt(size_t index) const { assert(index < callCount()); return m_calls[index]; }
+    uint64_t callInclusiveCost(size_t callIndex, size_t eventIndex) const;
+
+    // The files of the jump positions, inlined code gives jumps in other files than the file of the function.
+    size_t indexForSourceFile(const string &file);
+    size_t sourceFileCount() const { return m_sourceFiles.size(); }
+    const string &sourceFileAt(size_t index) const { assert(index < sourceFileCount()); return m_sourceFiles[index]; }
+
+    void addJump(size_t functionIndex, const JumpTable::Jump &jump);
+    const JumpTable &jumpTableAt(size_t functionIndex) const { assert(functionIndex < functionDescriptorCount()); return m_jumpTables[functionIndex]; }
+
+    struct Branch {
+        size_t functionIndex;
+        JumpTable::Jump jump;
+    };
+    // The most executed conditional jumps of the profile, by decreasing execution count.
+    vector<Branch> hottestConditionalBranches(size_t maxCount) const;
 
 private:
+    const vector<double> &derivedEventColumn(size_t eventIndex) const;
+
     string m_command;
     vector<FunctionDescriptor*> m_functionDescriptors;
+    tr1::unordered_map<string, size_t> m_functionIndexes;
+
+    vector<string> m_nativeEventNames;
+    vector<EventFormula> m_derivedEvents;
+
+    // Indexed by [event][function], so each event is a contiguous column.
+    vector<vector<uint64_t> > m_nativeSelfCosts;
+    mutable vector<vector<double> > m_derivedSelfCosts;
+    mutable bool m_derivedSelfCostsValid;
+
+    vector<JumpTable> m_jumpTables;
+    vector<string> m_sourceFiles;
+    tr1::unordered_map<string, size_t> m_sourceFileIndexes;
+
+    vector<Call> m_calls;
+    // Indexed by [call * nativeEventCount + event].
+    vector<uint64_t> m_callInclusiveCosts;
 };
 
 }